@@ -5,6 +5,9 @@
 #define INIDESKTOP 1
 #define COL_NORM 0x444444
 #define COL_HIGH 0x335588
+#define SYNCTIMEOUT 100 /* ms to wait for a client to redraw after a resize */
+#define KILLTIMEOUT 2000 /* ms a closing client has to answer a ping */
+#define FOCUSMRU 0 /* 1 to cycle windows in most recently used order */
 
 static const Rule rules[] = {
 	/* xprop(1):
@@ -26,7 +29,12 @@ static Key keys[] = {
 	{ Mod1Mask|ShiftMask,    XK_Tab,    focusstack,   {.i = -1 } },
 	{ Mod1Mask,              XK_l,      setmfact,     {.f = +0.02 } },
 	{ Mod1Mask,              XK_h,      setmfact,     {.f = -0.02 } },
+	{ Mod4Mask,              XK_s,      setlayout,    {.i = LSplit } },
+	{ Mod4Mask,              XK_c,      setlayout,    {.i = LColumns } },
+	{ Mod4Mask,              XK_g,      setlayout,    {.i = LGrid } },
+	{ Mod4Mask,              XK_m,      setlayout,    {.i = LMonocle } },
 	{ Mod1Mask,              XK_F4,     killclient,   {0} },
+	{ Mod1Mask|ShiftMask,    XK_r,      restart,      {0} },
 	{ Mod4Mask,              XK_F1,     view,         {.ui = 0 } },
 	{ Mod4Mask,              XK_F2,     view,         {.ui = 1 } },
 	{ Mod4Mask,              XK_F3,     view,         {.ui = 2 } },
@@ -34,6 +42,10 @@ static Key keys[] = {
 	{ Mod1Mask|ControlMask,  XK_Left,   viewrel,      {.i = -1 } },
 	{ Mod1Mask|ShiftMask,    XK_Right,  tagrel,       {.i = +1 } },
 	{ Mod1Mask|ShiftMask,    XK_Left,   tagrel,       {.i = -1 } },
+	{ Mod4Mask,              XK_Right,  focusmon,     {.i = +1 } },
+	{ Mod4Mask,              XK_Left,   focusmon,     {.i = -1 } },
+	{ Mod4Mask|ShiftMask,    XK_Right,  tagmon,       {.i = +1 } },
+	{ Mod4Mask|ShiftMask,    XK_Left,   tagmon,       {.i = -1 } },
 	{ Mod1Mask,              XK_Down,   setposition,  {.i = PFloat } },
 	{ Mod1Mask,              XK_Up,     setposition,  {.i = PMax } },
 	{ Mod1Mask,              XK_Left,   setposition,  {.i = PLeft } },
@@ -0,0 +1,68 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Times the layout functions alone, then arrange() with unchanged inputs,
+ * without any X requests. Run with `make bench`.
+ */
+#define main xiwmmain
+#include "xiwm.c"
+#undef main
+
+int
+main(void)
+{
+	static const int counts[] = { 10, 100, 1000, 10000 };
+	Rect wa = { 0, 20, 1920, 1060 }, *g;
+	Position *pos;
+	Monitor *m;
+	Client *c;
+	long long t, reps;
+	unsigned int i, l;
+	int j, n;
+
+	for (i = 0; i < LENGTH(counts); i++) {
+		n = counts[i];
+		pos = calloc(n, sizeof(Position));
+		g = calloc(n, sizeof(Rect));
+		for (j = 0; j < n; j++)
+			pos[j] = j % 3 ? PRight : PLeft;
+		reps = 10000000 / n;
+		for (l = 0; l < LENGTH(layouts); l++) {
+			t = now();
+			for (j = 0; j < reps; j++)
+				layouts[l].arrange(g, pos, n, wa, 0.5);
+			t = now() - t;
+			printf("%-8s n=%-6d %8.1fns/call %6.2fns/client\n", layouts[l].name,
+				n, t * 1000.0 / reps, t * 1000.0 / reps / n);
+		}
+		/* clients start where the layout puts them, so arrange() hits
+		 * the memo and sends nothing */
+		m = createmon();
+		m->wx = wa.x; m->wy = wa.y; m->ww = wa.w; m->wh = wa.h;
+		layouts[m->lt[desktop]].arrange(g, pos, n, wa, m->mfact[desktop]);
+		for (j = n - 1; j >= 0; j--) {
+			c = calloc(1, sizeof(Client));
+			c->win = j + 1;
+			c->position = pos[j];
+			c->x = g[j].x; c->y = g[j].y;
+			c->w = g[j].w - 2; c->h = g[j].h - 2; c->bw = 1;
+			c->next = m->clients;
+			m->clients = c;
+		}
+		t = now();
+		for (j = 0; j < reps; j++)
+			arrange(m);
+		t = now() - t;
+		printf("%-8s n=%-6d %8.1fns/call %6.2fns/client\n", "arrange",
+			n, t * 1000.0 / reps, t * 1000.0 / reps / n);
+		while ((c = m->clients)) {
+			m->clients = c->next;
+			free(c);
+		}
+		free(m->memo[desktop].pos);
+		free(m->memo[desktop].g);
+		free(m);
+		free(pos);
+		free(g);
+	}
+	return 0;
+}
@@ -3,16 +3,31 @@
  * Code is based on dwm <https://dwm.suckless.org>
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <X11/Xatom.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/sync.h>
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
 
 /* macros */
 #define BUTTONMASK       (ButtonPressMask|ButtonReleaseMask)
@@ -21,18 +36,30 @@
 #define LENGTH(X)        (sizeof X / sizeof X[0])
 #define MOUSEMASK        (BUTTONMASK|PointerMotionMask)
 #define MAX(A, B)        ((A) > (B) ? (A) : (B))
+#define MIN(A, B)        ((A) < (B) ? (A) : (B))
 #define WINMASK          (FocusChangeMask|PropertyChangeMask)
-#define ROOTMASK         (SubstructureRedirectMask|SubstructureNotifyMask|ButtonPressMask|PointerMotionMask|PropertyChangeMask)
+#define CONFIGMASK       (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE)
+#define ROOTMASK         (SubstructureRedirectMask|SubstructureNotifyMask|StructureNotifyMask|ButtonPressMask|PointerMotionMask|PropertyChangeMask)
+#define ISTILED(C)       (ISVISIBLE(C) && !(C)->isfullscreen && ((C)->position == PLeft || (C)->position == PRight))
+#define STATEVERSION     5
+#define STATECLIENT      15
+#define SHMMAGIC         0x6d776978 /* "xiwm" */
+#define SHMVERSION       1
 
 /* enums */
 enum {
 	NetSupported, NetWMName, NetWMDesktop, NetWMState, NetWMCheck,
 	NetWMFullscreen, NetActiveWindow, NetWMWindowType,
 	NetWMWindowTypeDialog, NetWMWindowTypeDock,
-	NetClientList, NetCurrentDesktop, NetNumberOfDesktops, NetLast
+	NetClientList, NetCurrentDesktop, NetNumberOfDesktops, NetWMPid,
+	NetWMStrut, NetWMStrutPartial, NetWorkarea,
+	NetWMSyncRequest, NetWMSyncRequestCounter, NetWMBypassCompositor, NetWMPing,
+	NetLast
 }; /* EWMH atoms */
-enum { WMProtocols, WMDelete, WMState, WMLast }; /* default atoms */
+enum { WMProtocols, WMDelete, WMState, XiwmState, XiwmShm, WMLast }; /* default atoms */
 typedef enum { PFloat, PMax, PLeft, PRight } Position;
+enum { LSplit, LColumns, LGrid, LMonocle }; /* layouts */
+enum { MSpawnExec, MSpawnMap, MMotion, MLayout, MClose, MMonitors, MConfig, MLast }; /* metrics */
 
 typedef union {
 	int i;
@@ -41,14 +68,41 @@ typedef union {
 	const void *v;
 } Arg;
 
+typedef struct {
+	int x, y, w, h;
+} Rect;
+
+typedef struct {
+	const char *name;
+	void (*arrange)(Rect *g, const Position *pos, int n, Rect wa, float mfact);
+} Layout;
+
+typedef struct {
+	unsigned long long key;      /* hash of the inputs g was computed from */
+	Position *pos;
+	Rect *g;                     /* outer geometry of the tiled clients, in list order */
+	int n, cap;
+} Memo;
+
+typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
 	int x, y, w, h;
 	int fx, fy, fw, fh;
 	unsigned int desktop;
 	Position position;
-	Bool isfixed, isfullscreen, isdock;
+	int bw;
+	Bool isfixed, isfullscreen, isdock, candelete, canping;
+	Bool setbypass;              /* _NET_WM_BYPASS_COMPOSITOR was set by us, not the client */
+	long strut[12];              /* reserved screen edges of a dock, as _NET_WM_STRUT_PARTIAL */
+	long long closetime, killdeadline;
+	Bool syncdirty;              /* geometry changed while waiting for the client */
+	long long syncvalue, syncdeadline;
+	XSyncCounter synccounter;
+	XSyncAlarm syncalarm;
 	Client *next, *transient;
+	Client *mprev, *mnext;       /* most recently used ring of the desktop */
+	Monitor *mon;
 	Window win;
 };
 
@@ -56,7 +110,7 @@ typedef struct {
 	unsigned int mod;
 	KeySym keysym;
 	void (*func)(const Arg *);
-	const Arg arg;
+	Arg arg;
 } Key;
 
 typedef struct {
@@ -66,6 +120,75 @@ typedef struct {
 	Position position;
 } Rule;
 
+typedef struct {
+	const Key *keys;
+	unsigned int nkeys;
+	const Rule *rules;
+	unsigned int nrules;
+	unsigned long colnorm, colhigh;
+	char *strings;
+	char **argv;
+} Config;
+
+enum { ArgNone, ArgInt, ArgUint, ArgFloat, ArgPosition, ArgLayout, ArgCmd };
+typedef struct {
+	const char *name;
+	void (*func)(const Arg *);
+	int arg;
+} Func;
+
+typedef struct {
+	const char *name;
+	unsigned long n;
+	long long sum, max;
+} Metric;
+
+typedef struct {
+	pid_t pid;
+	long long time;
+} Launch;
+
+/* shared memory snapshot, see README */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;                /* odd while an update is in progress */
+	uint32_t size;               /* bytes in use */
+	uint32_t desktop, ndesktops;
+	uint32_t active;             /* focused window or 0 */
+	uint32_t layout;             /* of the focused monitor and current desktop */
+	float mfact;
+	uint32_t nclients;
+} ShmHeader;
+
+typedef struct {
+	uint32_t win;
+	uint32_t desktop;
+	uint32_t position;
+	uint32_t flags;              /* 1 fullscreen, 2 dock, 4 focused */
+	int32_t x, y, w, h;
+	uint32_t monitor;
+} ShmClient;
+
+typedef struct {
+	unsigned long serial;         /* first request sent on behalf of name */
+	const char *name;
+} Origin;
+
+typedef struct {
+	const char *origin;
+	unsigned char request, error;
+	Bool benign;
+	unsigned long n;
+} XError;
+
+typedef struct {
+	Config *c;
+	Key *keys;
+	Rule *rules;
+	unsigned int capkeys, caprules, nargv, capargv;
+} Parser;
+
 /* actions */
 static void tag(const Arg *arg);
 static void tagrel(const Arg *arg);
@@ -74,42 +197,142 @@ static void viewrel(const Arg *arg);
 static void focusstack(const Arg *arg);
 static void setposition(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setlayout(const Arg *arg);
 static void killclient(const Arg *arg);
 static void spawn(const Arg *arg);
+static void restart(const Arg *arg);
+static void focusmon(const Arg *arg);
+static void tagmon(const Arg *arg);
+
+/* layouts */
+static void split(Rect *g, const Position *pos, int n, Rect wa, float mfact);
+static void columns(Rect *g, const Position *pos, int n, Rect wa, float mfact);
+static void grid(Rect *g, const Position *pos, int n, Rect wa, float mfact);
+static void monocle(Rect *g, const Position *pos, int n, Rect wa, float mfact);
 
 /* X event handlers */
 static void keypress(XEvent *e);
+static void keyrelease(XEvent *e);
 static void buttonpress(XEvent *e);
 static void clientmessage(XEvent *e);
 static void unmapnotify(XEvent *e);
 static void configurerequest(XEvent *e);
 static void maprequest(XEvent *e);
+static void configurenotify(XEvent *e);
+static void propertynotify(XEvent *e);
 
 /* signals */
 static void sigchld(int unused);
+static void sigusr1(int unused);
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
 
+struct Monitor {
+	int mx, my, mw, mh;          /* output geometry */
+	int wx, wy, ww, wh;          /* work area, without the docks' struts */
+	int refresh;                 /* refresh rate in Hz */
+	float mfact[DESKTOPS];
+	unsigned int lt[DESKTOPS];   /* index into layouts */
+	Memo memo[DESKTOPS];
+	Client *clients;
+	Client *fs[DESKTOPS];        /* fullscreen client that covers the desktop */
+	Monitor *next;
+};
+
 /* variables */
 static const char broken[] = "broken";
 static int sw, sh;           /* X display screen geometry width, height */
-static int bh;               /* bar geometry */
+static int syncevbase, syncerrbase;
+static Bool hassync;
+#ifdef XRANDR
+static int rrevbase;
+static Bool hasrandr;
+#endif /* XRANDR */
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[KeyPress] = keypress,
+	[KeyRelease] = keyrelease,
 	[ButtonPress] = buttonpress,
 	[ClientMessage] = clientmessage,
 	[UnmapNotify] = unmapnotify,
 	[MapRequest] = maprequest,
 	[ConfigureRequest] = configurerequest,
+	[ConfigureNotify] = configurenotify,
+	[PropertyNotify] = propertynotify,
+};
+static const char *handlername[LASTEvent] = {
+	[KeyPress] = "keypress",
+	[KeyRelease] = "keyrelease",
+	[ButtonPress] = "buttonpress",
+	[ClientMessage] = "clientmessage",
+	[UnmapNotify] = "unmapnotify",
+	[MapRequest] = "maprequest",
+	[ConfigureRequest] = "configurerequest",
+	[ConfigureNotify] = "configurenotify",
+	[PropertyNotify] = "propertynotify",
 };
 static Atom wmatom[WMLast], netatom[NetLast];
 static unsigned int desktop;
-static float mfact = 0.5;
 static Display *dpy;
-static Client *clients;
+static Monitor *mons, *selmon;
 static Client *sel[DESKTOPS];
+static long workarea[4];      /* published _NET_WORKAREA */
+static Client *mru[DESKTOPS];      /* most recently focused client of each desktop */
+static Bool mrucycle;         /* focusstack() is cycling, the keyboard is grabbed */
 static Window root, wmcheckwin;
+static char **args;
+static Bool restarted;        /* took over from a restarting instance */
+static Config defconfig = { keys, LENGTH(keys), rules, LENGTH(rules), COL_NORM, COL_HIGH };
+static Config *cfg = &defconfig;
+static char *configdir, *configpath;
+static int inotifyfd = -1, configwd = -1;
+static posix_spawnattr_t spawnattr;
+static long long keytime;     /* when the last key binding was triggered */
+static Launch launches[8];    /* spawned processes waiting for their first window */
+static unsigned int nextlaunch;
+static volatile sig_atomic_t dumpmetrics;
+static Metric metrics[MLast] = {
+	[MSpawnExec] = { "keypress to exec" },
+	[MSpawnMap] = { "keypress to map" },
+	[MMotion] = { "pointer to configure" },
+	[MLayout] = { "layout" },
+	[MClose] = { "close to gone" },
+	[MMonitors] = { "monitor change" },
+	[MConfig] = { "config parse" },
+};
+static long long starttime;
+static Origin origins[32];    /* recent requests by the code that sent them */
+static unsigned int norigins;
+static XError xerrors[64];
+static unsigned int nxerrors;
+static unsigned long xerrorsdropped;
+static int shmfd = -1;
+static ShmHeader *shm;
+static size_t shmsize;
+static const Func funcs[] = {
+	{ "tag",          tag,          ArgUint },
+	{ "tagrel",       tagrel,       ArgInt },
+	{ "view",         view,         ArgUint },
+	{ "viewrel",      viewrel,      ArgInt },
+	{ "focusstack",   focusstack,   ArgInt },
+	{ "setposition",  setposition,  ArgPosition },
+	{ "setmfact",     setmfact,     ArgFloat },
+	{ "setlayout",    setlayout,    ArgLayout },
+	{ "killclient",   killclient,   ArgNone },
+	{ "spawn",        spawn,        ArgCmd },
+	{ "restart",      restart,      ArgNone },
+	{ "focusmon",     focusmon,     ArgInt },
+	{ "tagmon",       tagmon,       ArgInt },
+};
+static const char *positions[] = {
+	[PFloat] = "float", [PMax] = "max", [PLeft] = "left", [PRight] = "right",
+};
+static const Layout layouts[] = {
+	[LSplit] = { "split", split },
+	[LColumns] = { "columns", columns },
+	[LGrid] = { "grid", grid },
+	[LMonocle] = { "monocle", monocle },
+};
 
 void
 die(const char *fmt, ...) {
@@ -137,9 +360,113 @@ sigchld(int unused)
 	while (0 < waitpid(-1, NULL, WNOHANG));
 }
 
+void
+sigusr1(int unused)
+{
+	if (signal(SIGUSR1, sigusr1) == SIG_ERR)
+		die("can't install SIGUSR1 handler:");
+	dumpmetrics = 1;
+}
+
+long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void
+record(int m, long long usec)
+{
+	metrics[m].n++;
+	metrics[m].sum += usec;
+	metrics[m].max = MAX(metrics[m].max, usec);
+}
+
+void
+printmetrics(void)
+{
+	unsigned int i;
+	char num[8], req[64], err[64];
+	double hours = MAX(now() - starttime, 1000000) / 3600e6;
+
+	for (i = 0; i < MLast; i++)
+		fprintf(stderr, "xiwm: %s: n=%lu avg=%lldus max=%lldus\n", metrics[i].name,
+			metrics[i].n, metrics[i].n ? metrics[i].sum / (long long)metrics[i].n : 0,
+			metrics[i].max);
+	for (i = 0; i < nxerrors; i++) {
+		snprintf(num, sizeof(num), "%d", xerrors[i].request);
+		XGetErrorDatabaseText(dpy, "XRequest", num, num, req, sizeof(req));
+		XGetErrorText(dpy, xerrors[i].error, err, sizeof(err));
+		fprintf(stderr, "xiwm: X error %s on %s from %s: n=%lu rate=%.1f/h%s\n",
+			err, req, xerrors[i].origin, xerrors[i].n, xerrors[i].n / hours,
+			xerrors[i].benign ? "" : " unexpected");
+	}
+	if (xerrorsdropped)
+		fprintf(stderr, "xiwm: X errors not classified: n=%lu\n", xerrorsdropped);
+}
+
+/* remember who sends the following requests, so errors can be attributed */
+void
+setorigin(const char *name)
+{
+	unsigned long serial = NextRequest(dpy);
+
+	if (norigins && origins[(norigins - 1) % LENGTH(origins)].serial == serial)
+		norigins--;
+	origins[norigins % LENGTH(origins)].serial = serial;
+	origins[norigins % LENGTH(origins)].name = name;
+	norigins++;
+}
+
+Bool
+xerrorbenign(XErrorEvent *ee)
+{
+	/* a client can destroy its window while requests for it are in flight */
+	return ee->error_code == BadWindow
+	|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
+	|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
+	|| (ee->request_code == X_KillClient && ee->error_code == BadValue)
+	|| (ee->request_code == X_GrabButton && ee->error_code == BadAccess)
+	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
+	|| (hassync && ee->error_code == syncerrbase + XSyncBadCounter)
+	|| (hassync && ee->error_code == syncerrbase + XSyncBadAlarm);
+}
+
+/* X errors are never fatal, count them by origin, request and error code */
 int
-xerrordummy(Display *dpy, XErrorEvent *ee)
+xerror(Display *dpy, XErrorEvent *ee)
 {
+	const char *origin = "unknown";
+	unsigned int i;
+	XError *e;
+
+	for (i = 1; i <= MIN(norigins, LENGTH(origins)); i++)
+		if (origins[(norigins - i) % LENGTH(origins)].serial <= ee->serial) {
+			origin = origins[(norigins - i) % LENGTH(origins)].name;
+			break;
+		}
+	for (i = 0; i < nxerrors; i++)
+		if (xerrors[i].origin == origin && xerrors[i].request == ee->request_code
+		&& xerrors[i].error == ee->error_code)
+			break;
+	if (i == LENGTH(xerrors)) {
+		xerrorsdropped++;
+		return 0;
+	}
+	e = &xerrors[i];
+	if (i == nxerrors) {
+		nxerrors++;
+		e->origin = origin;
+		e->request = ee->request_code;
+		e->error = ee->error_code;
+		e->benign = xerrorbenign(ee);
+	}
+	if (!e->n++ && !e->benign)
+		fprintf(stderr, "xiwm: X error: request code=%d, error code=%d, from %s\n",
+			ee->request_code, ee->error_code, origin);
 	return 0;
 }
 
@@ -147,13 +474,41 @@ Client *
 wintoclient(Window w)
 {
 	Client *c;
+	Monitor *m;
 
-	for (c = clients; c; c = c->next)
-		if (c->win == w)
-			return c;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->win == w)
+				return c;
 	return NULL;
 }
 
+Monitor *
+recttomon(int x, int y, int w, int h)
+{
+	Monitor *m, *r = selmon;
+	int a, area = 0;
+
+	for (m = mons; m; m = m->next)
+		if ((a = MAX(0, MIN(x + w, m->mx + m->mw) - MAX(x, m->mx))
+			* MAX(0, MIN(y + h, m->my + m->mh) - MAX(y, m->my))) > area) {
+			area = a;
+			r = m;
+		}
+	return r;
+}
+
+Monitor *
+dirtomon(Monitor *m, int dir)
+{
+	Monitor *r;
+
+	if (dir > 0)
+		return m->next ? m->next : mons;
+	for (r = mons; r->next && r->next != m; r = r->next);
+	return r;
+}
+
 void
 grabbuttons(Client *c, Bool focused)
 {
@@ -180,36 +535,28 @@ grabkeys(void)
 	KeyCode code;
 
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
-	for (i = 0; i < LENGTH(keys); i++)
-		if ((code = XKeysymToKeycode(dpy, keys[i].keysym)))
+	for (i = 0; i < cfg->nkeys; i++)
+		if ((code = XKeysymToKeycode(dpy, cfg->keys[i].keysym)))
 			for (j = 0; j < LENGTH(modifiers); j++)
-				XGrabKey(dpy, code, keys[i].mod | modifiers[j], root,
+				XGrabKey(dpy, code, cfg->keys[i].mod | modifiers[j], root,
 					True, GrabModeAsync, GrabModeAsync);
 }
 
-Bool
-sendevent(Client *c, Atom proto)
+void
+sendevent(Client *c, Atom proto, long d2, long d3)
 {
-	int n;
-	Atom *protocols;
-	Bool exists = False;
 	XEvent ev;
 
-	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
-		while (!exists && n--)
-			exists = protocols[n] == proto;
-		XFree(protocols);
-	}
-	if (exists) {
-		ev.type = ClientMessage;
-		ev.xclient.window = c->win;
-		ev.xclient.message_type = wmatom[WMProtocols];
-		ev.xclient.format = 32;
-		ev.xclient.data.l[0] = proto;
-		ev.xclient.data.l[1] = CurrentTime;
-		XSendEvent(dpy, c->win, False, NoEventMask, &ev);
-	}
-	return exists;
+	ev.type = ClientMessage;
+	ev.xclient.window = c->win;
+	ev.xclient.message_type = wmatom[WMProtocols];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = proto;
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = d2;
+	ev.xclient.data.l[3] = d3;
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, c->win, False, NoEventMask, &ev);
 }
 
 void
@@ -228,71 +575,244 @@ xsetclientdesktop(Client *c)
 		PropModeReplace, (unsigned char *) &(c->desktop), 1);
 }
 
+void
+syncrequest(Client *c)
+{
+	XSyncValue v;
+	XSyncAlarmAttributes aa;
+
+	if (!c->syncvalue && XSyncQueryCounter(dpy, c->synccounter, &v))
+		c->syncvalue = (long long)XSyncValueHigh32(v) << 32 | XSyncValueLow32(v);
+	c->syncvalue++;
+	sendevent(c, netatom[NetWMSyncRequest], c->syncvalue & 0xffffffff,
+		c->syncvalue >> 32);
+
+	/* the alarm fires once the client has redrawn at the new size */
+	XSyncIntsToValue(&aa.trigger.wait_value, c->syncvalue & 0xffffffff, c->syncvalue >> 32);
+	if (c->syncalarm) {
+		XSyncChangeAlarm(dpy, c->syncalarm, XSyncCAValue, &aa);
+	} else {
+		aa.trigger.counter = c->synccounter;
+		aa.trigger.value_type = XSyncAbsolute;
+		aa.trigger.test_type = XSyncPositiveComparison;
+		XSyncIntToValue(&aa.delta, 0);
+		aa.events = True;
+		c->syncalarm = XSyncCreateAlarm(dpy, XSyncCACounter|XSyncCAValueType
+			|XSyncCAValue|XSyncCATestType|XSyncCADelta|XSyncCAEvents, &aa);
+	}
+	c->syncdeadline = now() + SYNCTIMEOUT * 1000LL;
+}
+
+void
+configure(Client *c, Bool sized)
+{
+	XWindowChanges wc = { c->x, c->y, c->w, c->h, c->bw };
+
+	if (sized && c->synccounter)
+		syncrequest(c);
+	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+}
+
 void
 resize(Client *c, int x, int y, int w, int h, int bw)
 {
-	XWindowChanges wc;
+	Bool sized = w != c->w || h != c->h;
 
-	c->x = wc.x = x;
-	c->y = wc.y = y;
-	c->w = wc.width = w;
-	c->h = wc.height = h;
+	c->x = x;
+	c->y = y;
+	c->w = w;
+	c->h = h;
+	c->bw = bw;
 	if (c->position == PFloat && !c->isfullscreen) {
 		c->fx = c->x;
 		c->fy = c->y;
 		c->fw = c->w;
 		c->fh = c->h;
 	}
-	wc.border_width = bw;
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+	/* never send a new size before the client has caught up */
+	if (c->syncdeadline)
+		c->syncdirty = True;
+	else
+		configure(c, sized);
 }
 
 void
-layoutcolumn(Position pos, int x, int w)
+syncdone(Client *c)
 {
-	Client *c;
-	unsigned int n = 0;
-	int y = bh, h;
+	c->syncdeadline = 0;
+	if (c->syncdirty) {
+		c->syncdirty = False;
+		/* hidden in the meantime, layout() will size it when it returns */
+		if (ISVISIBLE(c))
+			configure(c, True);
+	}
+}
 
-	for (c = clients; c; c = c->next)
-		if (ISVISIBLE(c) && !c->isfullscreen && c->position == pos)
-			n++;
+void
+syncalarm(XEvent *e)
+{
+	XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)e;
+	Client *c;
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->syncalarm == ev->alarm) {
+				if (c->syncdeadline)
+					syncdone(c);
+				return;
+			}
+}
 
-	for (c = clients; c; c = c->next)
-		if (ISVISIBLE(c) && !c->isfullscreen && c->position == pos) {
-			h = (sh - y) / n;
-			resize(c, x, y, w - 2, h - 2, 1);
-			y += h;
-			n -= 1;
+/* left and right columns, the left one is mfact wide */
+void
+split(Rect *g, const Position *pos, int n, Rect wa, float mfact)
+{
+	int i, nl = 0, nr = 0, ly = wa.y, ry = wa.y, lw = wa.w * mfact;
+
+	for (i = 0; i < n; i++)
+		if (pos[i] == PLeft)
+			nl++;
+	nr = n - nl;
+	for (i = 0; i < n; i++)
+		if (pos[i] == PLeft) {
+			g[i] = (Rect){ wa.x, ly, lw, (wa.y + wa.h - ly) / nl-- };
+			ly += g[i].h;
+		} else {
+			g[i] = (Rect){ wa.x + lw, ry, wa.w - lw, (wa.y + wa.h - ry) / nr-- };
+			ry += g[i].h;
 		}
 }
 
 void
-layout(void)
+columns(Rect *g, const Position *pos, int n, Rect wa, float mfact)
 {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		g[i].x = wa.x + wa.w * i / n;
+		g[i].w = wa.x + wa.w * (i + 1) / n - g[i].x;
+		g[i].y = wa.y;
+		g[i].h = wa.h;
+	}
+}
+
+void
+grid(Rect *g, const Position *pos, int n, Rect wa, float mfact)
+{
+	int i, cols, rows, row, col, ncols;
+
+	for (cols = 1; cols * cols < n; cols++);
+	rows = (n + cols - 1) / MAX(cols, 1);
+	for (i = 0; i < n; i++) {
+		row = i / cols;
+		col = i % cols;
+		/* the last row shares its width among fewer windows */
+		ncols = row == rows - 1 ? n - row * cols : cols;
+		g[i].x = wa.x + wa.w * col / ncols;
+		g[i].w = wa.x + wa.w * (col + 1) / ncols - g[i].x;
+		g[i].y = wa.y + wa.h * row / rows;
+		g[i].h = wa.y + wa.h * (row + 1) / rows - g[i].y;
+	}
+}
+
+void
+monocle(Rect *g, const Position *pos, int n, Rect wa, float mfact)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		g[i] = wa;
+}
+
+unsigned long long
+hash(unsigned long long h, long v)
+{
+	return (h ^ (unsigned long long)v) * 1099511628211ULL;
+}
+
+/* tiles the visible clients, recomputing the geometry only when its inputs changed */
+void
+arrange(Monitor *m)
+{
+	Memo *mo = &m->memo[desktop];
 	Client *c;
+	Rect wa = { m->wx, m->wy, m->ww, m->wh };
+	unsigned long long key = 14695981039346656037ULL;
+	int i, n = 0;
+
+	key = hash(key, m->lt[desktop]);
+	key = hash(key, m->mfact[desktop] * 1000000);
+	key = hash(hash(hash(hash(key, wa.x), wa.y), wa.w), wa.h);
+	for (c = m->clients; c; c = c->next)
+		if (ISTILED(c)) {
+			key = hash(hash(key, c->win), c->position);
+			n++;
+		}
+	if (key != mo->key || n != mo->n) {
+		if (n > mo->cap) {
+			mo->cap = n * 2;
+			if (!(mo->pos = realloc(mo->pos, mo->cap * sizeof(Position)))
+			|| !(mo->g = realloc(mo->g, mo->cap * sizeof(Rect))))
+				die("xiwm: realloc:");
+		}
+		for (i = 0, c = m->clients; c; c = c->next)
+			if (ISTILED(c))
+				mo->pos[i++] = c->position;
+		layouts[m->lt[desktop]].arrange(mo->g, mo->pos, n, wa, m->mfact[desktop]);
+		mo->key = key;
+		mo->n = n;
+	}
+	/* clients already in place cost no requests */
+	for (i = 0, c = m->clients; c; c = c->next)
+		if (ISTILED(c)) {
+			if (c->x != mo->g[i].x || c->y != mo->g[i].y || c->w != mo->g[i].w - 2
+			|| c->h != mo->g[i].h - 2 || c->bw != 1)
+				resize(c, mo->g[i].x, mo->g[i].y, mo->g[i].w - 2, mo->g[i].h - 2, 1);
+			i++;
+		}
+}
+
+void
+layout(Monitor *m)
+{
+	Client *c, *f;
 	XWindowChanges wc;
+	long long t;
+
+	if (!m) {
+		for (m = mons; m; m = m->next)
+			layout(m);
+		return;
+	}
+	f = m->fs[desktop];
+	t = now();
 
 	// show before hide to avoid flicker
-	for (c = clients; c; c = c->next) {
+	for (c = m->clients; c; c = c->next) {
 		if (c->isdock || !ISVISIBLE(c))
 			continue;
+		/* nothing behind a fullscreen window needs to be touched */
+		if (f && c != f && c->transient != f)
+			continue;
 		if (c->isfullscreen)
-			resize(c, 0, 0, sw, sh, 0);
+			resize(c, m->mx, m->my, m->mw, m->mh, 0);
 		else if (c->position == PFloat)
 			resize(c, c->fx, c->fy, c->fw, c->fh, 1);
 		else if (c->position == PMax)
-			resize(c, 0, bh, sw, sh - bh, 0);
+			resize(c, m->wx, m->wy, m->ww, m->wh, 0);
 	}
 
-	for (c = clients; c; c = c->next)
-		if (!ISVISIBLE(c) && !c->isdock) {
-			wc.x = sw * -2;
+	for (c = m->clients; c; c = c->next)
+		if (!ISVISIBLE(c) && !c->isdock && c->x != sw * -2) {
+			/* remember it, so arrange() does not take it for placed */
+			c->x = wc.x = sw * -2;
 			XConfigureWindow(dpy, c->win, CWX, &wc);
 		}
 
-	layoutcolumn(PLeft, 0, sw * mfact);
-	layoutcolumn(PRight, sw * mfact, sw - sw * mfact);
+	if (!f)
+		arrange(m);
+	record(MLayout, now() - t);
 }
 
 void
@@ -301,7 +821,7 @@ raiseclient(Client *c)
 	Client *i;
 
 	XRaiseWindow(dpy, c->win);
-	for (i = clients; i; i = i->next)
+	for (i = c->mon->clients; i; i = i->next)
 		if (i->transient == c)
 			XRaiseWindow(dpy, i->win);
 }
@@ -309,32 +829,160 @@ raiseclient(Client *c)
 void
 restack(void)
 {
-	Client *c;
+	Client *c, *s;
 	XEvent ev;
 
-	if (!sel[desktop])
+	if (!(s = sel[desktop]))
 		return;
-	if (sel[desktop]->position == PLeft || sel[desktop]->position == PRight)
-		for (c = clients; c; c = c->next)
+	if (s->mon->fs[desktop]) {
+		/* pinned on top, together with its dialogs */
+		raiseclient(s->mon->fs[desktop]);
+		return;
+	}
+	if (s->position == PLeft || s->position == PRight)
+		for (c = s->mon->clients; c; c = c->next)
 			if (ISVISIBLE(c) && (c->position == PLeft || c->position == PRight))
 				raiseclient(c);
-	raiseclient(sel[desktop]);
+	raiseclient(s);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+void
+mruattach(Client *c, Bool front)
+{
+	Client **h = &mru[c->desktop];
+
+	/* docks are never focused, clients already in the ring stay where they are */
+	if (c->isdock || c->mnext)
+		return;
+	if (*h) {
+		c->mnext = *h;
+		c->mprev = (*h)->mprev;
+		c->mprev->mnext = c;
+		(*h)->mprev = c;
+	} else
+		c->mprev = c->mnext = c;
+	if (front || !*h)
+		*h = c;
+}
+
+void
+mrudetach(Client *c)
+{
+	Client **h = &mru[c->desktop];
+
+	if (!c->mnext)
+		return;
+	if (c->mnext == c)
+		*h = NULL;
+	else {
+		c->mprev->mnext = c->mnext;
+		c->mnext->mprev = c->mprev;
+		if (*h == c)
+			*h = c->mnext;
+	}
+	c->mprev = c->mnext = NULL;
+}
+
+void
+mrupromote(Client *c)
+{
+	if (c != mru[c->desktop]) {
+		mrudetach(c);
+		mruattach(c, True);
+	}
+}
+
+void
+focus(Client *c)
+{
+	Client *i, *d, *f;
+
+	if ((!c || !ISVISIBLE(c)) && (c = mru[desktop]))
+		/* the most recently used window on the selected monitor */
+		for (; c->mon != selmon; c = c->mnext)
+			if (c->mnext == mru[desktop]) {
+				c = NULL;
+				break;
+			}
+	if (c && (f = c->mon->fs[desktop]) && c != f && c->transient != f)
+		c = f;
+	/* while cycling the order stays, the final window is promoted by mrucycleend() */
+	if (c && !mrucycle)
+		mrupromote(c);
+	if (sel[desktop] && sel[desktop] != c) {
+		grabbuttons(sel[desktop], False);
+		XSetWindowBorder(dpy, sel[desktop]->win, cfg->colnorm);
+	}
+	if (c) {
+		selmon = c->mon;
+		d = c;
+		for (i = c->mon->clients; i; i = i->next)
+			if (i->transient == c)
+				d = i;
+		XSetWindowBorder(dpy, d->win, cfg->colhigh);
+		grabbuttons(c, True);
+		XSetInputFocus(dpy, d->win, RevertToPointerRoot, CurrentTime);
+		XChangeProperty(dpy, root, netatom[NetActiveWindow], XA_WINDOW, 32,
+			PropModeReplace, (unsigned char *) &(d->win), 1);
+	} else {
+		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
+		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+	}
+	sel[desktop] = c;
+	restack();
+}
+
+void
+suspendsiblings(Client *f, Bool suspend)
+{
+	Client *c;
+
+	/* windows hidden behind a fullscreen window do not need to report anything */
+	for (c = f->mon->clients; c; c = c->next)
+		if (c->desktop == f->desktop && !c->isdock && c != f && c->transient != f)
+			XSelectInput(dpy, c->win, suspend ? NoEventMask : WINMASK);
+}
+
 void
 setfullscreen(Client *c, Bool fullscreen)
 {
+	long bypass = 1;
+	int di;
+	unsigned long dl;
+	unsigned char *p = NULL;
+	Atom da = None;
+
 	if (fullscreen && !c->isfullscreen) {
+		if (c->mon->fs[c->desktop])
+			setfullscreen(c->mon->fs[c->desktop], False);
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*) &netatom[NetWMFullscreen], 1);
+		/* a hint the client set itself, e.g. 2 to stay composited, wins */
+		if (XGetWindowProperty(dpy, c->win, netatom[NetWMBypassCompositor], 0L, 0L,
+			False, AnyPropertyType, &da, &di, &dl, &dl, &p) == Success && p)
+			XFree(p);
+		if ((c->setbypass = da == None))
+			XChangeProperty(dpy, c->win, netatom[NetWMBypassCompositor], XA_CARDINAL, 32,
+				PropModeReplace, (unsigned char*) &bypass, 1);
 		c->isfullscreen = True;
-		layout();
+		c->mon->fs[c->desktop] = c;
+		suspendsiblings(c, True);
+		layout(c->mon);
+		if (c->desktop == desktop)
+			focus(c);
 	} else if (!fullscreen && c->isfullscreen){
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*) 0, 0);
+		if (c->setbypass)
+			XDeleteProperty(dpy, c->win, netatom[NetWMBypassCompositor]);
+		c->setbypass = False;
 		c->isfullscreen = False;
-		layout();
+		if (c->mon->fs[c->desktop] == c) {
+			c->mon->fs[c->desktop] = NULL;
+			suspendsiblings(c, False);
+		}
+		layout(c->mon);
 	}
 }
 
@@ -346,7 +994,7 @@ setdesktop(unsigned int i)
 	desktop = i;
 	XChangeProperty(dpy, root, netatom[NetCurrentDesktop], XA_CARDINAL, 32,
 		PropModeReplace, (unsigned char *) &desktop, 1);
-	layout();
+	layout(NULL);
 }
 
 Atom
@@ -365,6 +1013,171 @@ getatomprop(Client *c, Atom prop)
 	return atom;
 }
 
+long
+getcardinalprop(Client *c, Atom prop)
+{
+	int di;
+	unsigned long dl;
+	unsigned char *p = NULL;
+	Atom da;
+	long n = 0;
+
+	if (XGetWindowProperty(dpy, c->win, prop, 0L, 1L, False, XA_CARDINAL,
+		&da, &di, &dl, &dl, &p) == Success && p) {
+		n = *(long *)p;
+		XFree(p);
+	}
+	return n;
+}
+
+void
+updatestrut(Client *c)
+{
+	int di, i;
+	unsigned long n = 0, dl;
+	unsigned char *p = NULL;
+	Atom da;
+
+	memset(c->strut, 0, sizeof(c->strut));
+	if (XGetWindowProperty(dpy, c->win, netatom[NetWMStrutPartial], 0L, 12L, False,
+		XA_CARDINAL, &da, &di, &n, &dl, &p) != Success || !p || n < 12) {
+		if (p)
+			XFree(p);
+		p = NULL;
+		n = 0;
+		XGetWindowProperty(dpy, c->win, netatom[NetWMStrut], 0L, 4L, False,
+			XA_CARDINAL, &da, &di, &n, &dl, &p);
+	}
+	if (p && n >= 4) {
+		for (i = 0; i < (int)MIN(n, 12); i++)
+			c->strut[i] = ((long *)p)[i];
+		if (n < 12)
+			/* plain _NET_WM_STRUT spans the whole edge */
+			for (i = 5; i < 12; i += 2)
+				c->strut[i] = LONG_MAX;
+	} else if (c->y + c->h / 2 > c->mon->my + c->mon->mh / 2) {
+		/* no struts, reserve the edge the dock is closest to */
+		c->strut[3] = sh - c->y;
+		c->strut[10] = c->x;
+		c->strut[11] = c->x + c->w - 1;
+	} else {
+		c->strut[2] = c->y + c->h;
+		c->strut[8] = c->x;
+		c->strut[9] = c->x + c->w - 1;
+	}
+	if (p)
+		XFree(p);
+}
+
+/* recompute the work areas from all struts, lay out only monitors whose area changed */
+void
+updateworkarea(void)
+{
+	Monitor *m, *dm;
+	Client *c;
+	long *s, wa[4] = { 0 }, prop[4 * DESKTOPS];
+	int i, x0, y0, x1, y1;
+
+	for (m = mons; m; m = m->next) {
+		x0 = m->mx;
+		y0 = m->my;
+		x1 = m->mx + m->mw;
+		y1 = m->my + m->mh;
+		for (dm = mons; dm; dm = dm->next)
+			for (c = dm->clients; c; c = c->next) {
+				if (!c->isdock)
+					continue;
+				s = c->strut;
+				if (s[0] > x0 && s[4] < m->my + m->mh && s[5] >= m->my)
+					x0 = MIN(s[0], m->mx + m->mw);
+				if (sw - s[1] < x1 && s[6] < m->my + m->mh && s[7] >= m->my)
+					x1 = MAX(sw - s[1], m->mx);
+				if (s[2] > y0 && s[8] < m->mx + m->mw && s[9] >= m->mx)
+					y0 = MIN(s[2], m->my + m->mh);
+				if (sh - s[3] < y1 && s[10] < m->mx + m->mw && s[11] >= m->mx)
+					y1 = MAX(sh - s[3], m->my);
+			}
+		if (x1 - x0 < 1 || y1 - y0 < 1) {
+			x0 = m->mx;
+			y0 = m->my;
+			x1 = m->mx + m->mw;
+			y1 = m->my + m->mh;
+		}
+		if (m->wx != x0 || m->wy != y0 || m->ww != x1 - x0 || m->wh != y1 - y0) {
+			m->wx = x0;
+			m->wy = y0;
+			m->ww = x1 - x0;
+			m->wh = y1 - y0;
+			layout(m);
+		}
+	}
+
+	/* _NET_WORKAREA covers the whole screen */
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->isdock) {
+				wa[0] = MAX(wa[0], c->strut[0]);
+				wa[1] = MAX(wa[1], c->strut[2]);
+				wa[2] = MAX(wa[2], c->strut[1]);
+				wa[3] = MAX(wa[3], c->strut[3]);
+			}
+	wa[2] = MAX(sw - wa[0] - wa[2], 1);
+	wa[3] = MAX(sh - wa[1] - wa[3], 1);
+	if (!memcmp(wa, workarea, sizeof(wa)))
+		return;
+	memcpy(workarea, wa, sizeof(wa));
+	for (i = 0; i < DESKTOPS; i++)
+		memcpy(&prop[4 * i], wa, sizeof(wa));
+	XChangeProperty(dpy, root, netatom[NetWorkarea], XA_CARDINAL, 32,
+		PropModeReplace, (unsigned char *) prop, LENGTH(prop));
+}
+
+void
+updateprotocols(Client *c)
+{
+	int n;
+	Atom *protocols;
+
+	c->candelete = c->canping = False;
+	if (!XGetWMProtocols(dpy, c->win, &protocols, &n))
+		return;
+	while (n--) {
+		if (protocols[n] == wmatom[WMDelete])
+			c->candelete = True;
+		else if (protocols[n] == netatom[NetWMPing])
+			c->canping = True;
+		else if (protocols[n] == netatom[NetWMSyncRequest] && hassync)
+			c->synccounter = getcardinalprop(c, netatom[NetWMSyncRequestCounter]);
+	}
+	XFree(protocols);
+}
+
+Bool
+islocal(Client *c)
+{
+	char host[256];
+	XTextProperty tp;
+	Bool local = False;
+
+	if (gethostname(host, sizeof host) < 0 || !XGetWMClientMachine(dpy, c->win, &tp))
+		return False;
+	if (tp.value && tp.encoding == XA_STRING && tp.format == 8)
+		local = tp.nitems == strlen(host) && !strncmp((char *)tp.value, host, tp.nitems);
+	XFree(tp.value);
+	return local;
+}
+
+void
+killwindow(Client *c)
+{
+	pid_t pid;
+
+	/* a hung process would keep running without its windows */
+	if ((pid = getcardinalprop(c, netatom[NetWMPid])) > 0 && islocal(c))
+		kill(pid, SIGKILL);
+	XKillClient(dpy, c->win);
+}
+
 void
 updatefixed(Client *c)
 {
@@ -380,11 +1193,8 @@ updatefixed(Client *c)
 void
 updatewindowtype(Client *c)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
 	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
 
-	if (state == netatom[NetWMFullscreen])
-		setfullscreen(c, True);
 	if (wtype == netatom[NetWMWindowTypeDialog])
 		c->position = PFloat;
 	if (wtype == netatom[NetWMWindowTypeDock])
@@ -404,8 +1214,8 @@ applyrules(Client *c)
 	class    = ch.res_class ? ch.res_class : broken;
 	instance = ch.res_name  ? ch.res_name  : broken;
 
-	for (i = 0; i < LENGTH(rules); i++) {
-		r = &rules[i];
+	for (i = 0; i < cfg->nrules; i++) {
+		r = &cfg->rules[i];
 		if ((!r->class || strstr(class, r->class))
 		&& (!r->instance || strstr(instance, r->instance)))
 		{
@@ -420,143 +1230,730 @@ applyrules(Client *c)
 }
 
 void
-attach(Client *c)
+attach(Client *c)
+{
+	c->next = c->mon->clients;
+	c->mon->clients = c;
+	mruattach(c, False);
+}
+
+void
+detach(Client *c)
+{
+	int i;
+	Client **tc;
+
+	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
+	*tc = c->next;
+	mrudetach(c);
+
+	/* fall back to the dialog's parent or the window used before */
+	for (i = 0; i < DESKTOPS; i++)
+		if (c == sel[i])
+			sel[i] = c->transient ? c->transient : mru[i];
+	if (c == c->mon->fs[c->desktop]) {
+		c->mon->fs[c->desktop] = NULL;
+		suspendsiblings(c, False);
+	}
+}
+
+void
+updatelaunch(Client *c)
+{
+	unsigned int i;
+	pid_t pid = 0;
+	long long t = now();
+
+	for (i = 0; i < LENGTH(launches); i++) {
+		if (!launches[i].pid)
+			continue;
+		if (t - launches[i].time > 10000000) {
+			launches[i].pid = 0;
+			continue;
+		}
+		if (!pid && !(pid = getcardinalprop(c, netatom[NetWMPid])))
+			return;
+		if (launches[i].pid == pid) {
+			record(MSpawnMap, t - launches[i].time);
+			launches[i].pid = 0;
+		}
+	}
+}
+
+void
+manage(Window w, XWindowAttributes *wa)
+{
+	Client *c, *t = NULL;
+	Window trans = None;
+
+	c = calloc(1, sizeof(Client));
+	c->win = w;
+	c->position = PMax;
+	c->desktop = desktop;
+	c->mon = wa->x || wa->y ? recttomon(wa->x, wa->y, wa->width, wa->height) : selmon;
+
+	applyrules(c);
+	updatelaunch(c);
+	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+		c->desktop = t->desktop;
+		c->mon = t->mon;
+	}
+	c->transient = t;
+
+	/* geometry */
+	c->fx = c->x = wa->x == 0 ? c->mon->wx + (c->mon->ww - wa->width) / 2 : wa->x;
+	c->fy = c->y = wa->y == 0 ? c->mon->wy + (c->mon->wh - wa->height) / 2 : wa->y;
+	c->fw = c->w = wa->width;
+	c->fh = c->h = wa->height;
+	xsetclientdesktop(c);
+	updatewindowtype(c);
+	updatefixed(c);
+	updateprotocols(c);
+	if (trans != None || c->isfixed)
+		c->position = PFloat;
+
+	if (c->isdock) {
+		/* docks stay where they are, a bar at 0,0 must not be centred */
+		c->fx = c->x = wa->x;
+		c->fy = c->y = wa->y;
+		c->mon = recttomon(c->x, c->y, c->w, c->h);
+		updatestrut(c);
+	}
+
+	XSetWindowBorder(dpy, c->win, cfg->colnorm);
+	XSelectInput(dpy, w, WINMASK);
+	grabbuttons(c, False);
+	attach(c);
+	/* only once attached, setfullscreen() focuses and lays out */
+	if (getatomprop(c, netatom[NetWMState]) == netatom[NetWMFullscreen])
+		setfullscreen(c, True);
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeAppend, (unsigned char *) &(c->win), 1);
+	xsetclientstate(c, NormalState);
+	XMapWindow(dpy, c->win);
+	focus(c);
+	if (c->isdock)
+		updateworkarea();
+	else
+		layout(c->mon);
+}
+
+void
+updateclientlist(void)
+{
+	Client *i;
+	Monitor *m;
+
+	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	for (m = mons; m; m = m->next)
+		for (i = m->clients; i; i = i->next)
+			XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+				PropModeAppend, (unsigned char *) &(i->win), 1);
+}
+
+void
+unmanage(Client *c)
+{
+	Monitor *m = c->mon;
+	Bool isdock = c->isdock;
+
+	if (c->syncalarm)
+		XSyncDestroyAlarm(dpy, c->syncalarm);
+	if (c->closetime)
+		record(MClose, now() - c->closetime);
+	detach(c);
+	free(c);
+	updateclientlist();
+	focus(sel[desktop]);
+	if (isdock)
+		updateworkarea();
+	else
+		layout(m);
+}
+
+Monitor *
+createmon(void)
+{
+	Monitor *m;
+	int i;
+
+	m = calloc(1, sizeof(Monitor));
+	for (i = 0; i < DESKTOPS; i++)
+		m->mfact[i] = 0.5;
+	m->refresh = 60;
+	return m;
+}
+
+void
+updategeom(void)
+{
+	Monitor *outs = NULL, *m, **mp;
+	Client *c;
+	int i, n = 0;
+	long long t = now();
+#ifdef XRANDR
+	int j;
+	XRRScreenResources *sr;
+	XRRCrtcInfo *ci;
+	XRRModeInfo *mi;
+
+	if (hasrandr && (sr = XRRGetScreenResourcesCurrent(dpy, root))) {
+		outs = calloc(MAX(sr->ncrtc, 1), sizeof(Monitor));
+		for (i = 0; i < sr->ncrtc; i++) {
+			if (!(ci = XRRGetCrtcInfo(dpy, sr, sr->crtcs[i])))
+				continue;
+			/* mirrored outputs share one crtc geometry */
+			for (j = 0; j < n; j++)
+				if (outs[j].mx == ci->x && outs[j].my == ci->y
+				&& outs[j].mw == (int)ci->width && outs[j].mh == (int)ci->height)
+					break;
+			if (ci->mode != None && ci->noutput > 0 && j == n) {
+				outs[n].mx = ci->x;
+				outs[n].my = ci->y;
+				outs[n].mw = ci->width;
+				outs[n].mh = ci->height;
+				outs[n].refresh = 60;
+				for (j = 0; j < sr->nmode; j++) {
+					mi = &sr->modes[j];
+					if (mi->id == ci->mode && mi->hTotal && mi->vTotal)
+						outs[n].refresh = mi->dotClock / ((double)mi->hTotal * mi->vTotal) + 0.5;
+				}
+				n++;
+			}
+			XRRFreeCrtcInfo(ci);
+		}
+		XRRFreeScreenResources(sr);
+	}
+#endif /* XRANDR */
+	if (!n) {
+		free(outs);
+		outs = calloc(1, sizeof(Monitor));
+		outs[0].mw = sw;
+		outs[0].mh = sh;
+		outs[0].refresh = 60;
+		n = 1;
+	}
+
+	/* keep monitors in order, a changed geometry invalidates the work area */
+	for (i = 0, mp = &mons; i < n; i++, mp = &(*mp)->next) {
+		if (!*mp)
+			*mp = createmon();
+		m = *mp;
+		m->refresh = MAX(outs[i].refresh, 1);
+		if (m->mx != outs[i].mx || m->my != outs[i].my
+		|| m->mw != outs[i].mw || m->mh != outs[i].mh) {
+			m->mx = outs[i].mx;
+			m->my = outs[i].my;
+			m->mw = outs[i].mw;
+			m->mh = outs[i].mh;
+			m->ww = 0;
+		}
+	}
+	/* clients of vanished outputs move to the first one */
+	while ((m = *mp)) {
+		*mp = m->next;
+		for (i = 0; i < DESKTOPS; i++)
+			if (m->fs[i])
+				setfullscreen(m->fs[i], False);
+		while ((c = m->clients)) {
+			/* the focus ring is per desktop, it keeps its order */
+			m->clients = c->next;
+			c->fx += mons->mx - m->mx;
+			c->fy += mons->my - m->my;
+			c->mon = mons;
+			attach(c);
+		}
+		if (selmon == m)
+			selmon = mons;
+		for (i = 0; i < DESKTOPS; i++) {
+			free(m->memo[i].pos);
+			free(m->memo[i].g);
+		}
+		free(m);
+		layout(mons);
+	}
+	if (!selmon)
+		selmon = mons;
+	free(outs);
+	updateworkarea();
+	record(MMonitors, now() - t);
+}
+
+/* runtime configuration */
+void *
+grow(void *p, unsigned int n, unsigned int *cap, size_t size)
+{
+	if (n < *cap)
+		return p;
+	*cap = *cap ? *cap * 2 : 16;
+	if (!(p = realloc(p, *cap * size)))
+		die("xiwm: realloc:");
+	return p;
+}
+
+const Func *
+findfunc(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(funcs); i++)
+		if (!strcmp(funcs[i].name, name))
+			return &funcs[i];
+	return NULL;
+}
+
+int
+findlayout(const char *name)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(layouts); i++)
+		if (!strcmp(layouts[i].name, name))
+			return i;
+	return -1;
+}
+
+int
+findposition(const char *name)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(positions); i++)
+		if (!strcmp(positions[i], name))
+			return i;
+	return -1;
+}
+
+Bool
+parsenum(const char *s, unsigned long *n)
+{
+	char *end;
+
+	*n = strtoul(s, &end, 0);
+	return *s && !*end;
+}
+
+Bool
+parsekey(char *s, Key *k)
+{
+	char *p;
+
+	k->mod = 0;
+	while ((p = strchr(s, '-')) && p[1]) {
+		if (p - s != 1)
+			return False;
+		switch (*s) {
+		case 'A': k->mod |= Mod1Mask; break;
+		case 'C': k->mod |= ControlMask; break;
+		case 'S': k->mod |= ShiftMask; break;
+		case 'W': k->mod |= Mod4Mask; break;
+		default: return False;
+		}
+		s = p + 1;
+	}
+	return (k->keysym = XStringToKeysym(s)) != NoSymbol;
+}
+
+const char *
+parseline(Parser *p, char **tok, int ntok)
+{
+	unsigned long n;
+	int i;
+	char *end;
+	const Func *f;
+	Key k;
+	Rule r;
+
+	if (!strcmp(tok[0], "colnorm") || !strcmp(tok[0], "colhigh")) {
+		if (ntok != 2 || !parsenum(tok[1], &n))
+			return "expected a color";
+		if (tok[0][3] == 'n')
+			p->c->colnorm = n;
+		else
+			p->c->colhigh = n;
+	} else if (!strcmp(tok[0], "rule")) {
+		if (ntok != 5)
+			return "expected class, instance, desktop and position";
+		r.class = strcmp(tok[1], "*") ? tok[1] : NULL;
+		r.instance = strcmp(tok[2], "*") ? tok[2] : NULL;
+		if (!parsenum(tok[3], &n) || n >= DESKTOPS)
+			return "invalid desktop";
+		r.desktop = n;
+		if ((i = findposition(tok[4])) < 0)
+			return "invalid position";
+		r.position = i;
+		p->rules = grow(p->rules, p->c->nrules, &p->caprules, sizeof(Rule));
+		p->rules[p->c->nrules++] = r;
+	} else if (!strcmp(tok[0], "key")) {
+		if (ntok < 3 || !parsekey(tok[1], &k))
+			return "invalid key";
+		if (!(f = findfunc(tok[2])))
+			return "unknown function";
+		k.func = f->func;
+		if ((f->arg == ArgNone) != (ntok == 3)
+		|| (f->arg != ArgCmd && ntok > 4))
+			return "wrong number of arguments";
+		switch (f->arg) {
+		case ArgNone:
+			k.arg.i = 0;
+			break;
+		case ArgInt:
+			k.arg.i = strtol(tok[3], &end, 0);
+			break;
+		case ArgUint:
+			k.arg.ui = strtoul(tok[3], &end, 0);
+			break;
+		case ArgFloat:
+			k.arg.f = strtof(tok[3], &end);
+			break;
+		case ArgPosition:
+			if ((k.arg.i = findposition(tok[3])) < 0)
+				return "invalid position";
+			end = "";
+			break;
+		case ArgLayout:
+			if ((k.arg.i = findlayout(tok[3])) < 0)
+				return "invalid layout";
+			end = "";
+			break;
+		case ArgCmd:
+			/* argv is resolved in parseconfig() once the pool stops moving */
+			k.arg.ui = p->nargv;
+			for (i = 3; i <= ntok; i++) {
+				p->c->argv = grow(p->c->argv, p->nargv, &p->capargv, sizeof(char *));
+				p->c->argv[p->nargv++] = i < ntok ? tok[i] : NULL;
+			}
+			end = "";
+			break;
+		}
+		if (f->arg != ArgNone && *end)
+			return "invalid argument";
+		p->keys = grow(p->keys, p->c->nkeys, &p->capkeys, sizeof(Key));
+		p->keys[p->c->nkeys++] = k;
+	} else {
+		return "unknown option";
+	}
+	return NULL;
+}
+
+void
+freeconfig(Config *c)
+{
+	if (!c || c == &defconfig)
+		return;
+	if (c->keys != defconfig.keys)
+		free((Key *)c->keys);
+	if (c->rules != defconfig.rules)
+		free((Rule *)c->rules);
+	free(c->argv);
+	free(c->strings);
+	free(c);
+}
+
+Config *
+parseconfig(const char *path, const char *buf, size_t len)
+{
+	Parser p = { NULL };
+	Config *c;
+	char *tok[32], *out;
+	const char *err = NULL;
+	unsigned int i, line = 1;
+	int ntok;
+	size_t pos = 0;
+
+	p.c = c = calloc(1, sizeof(Config));
+	c->colnorm = defconfig.colnorm;
+	c->colhigh = defconfig.colhigh;
+	/* tokens never take more room than the file itself */
+	out = c->strings = malloc(len + 1);
+
+	/* single pass: tokenize each line in place and apply it */
+	while (pos < len && !err) {
+		ntok = 0;
+		while (pos < len && buf[pos] != '\n') {
+			if (buf[pos] == ' ' || buf[pos] == '\t') {
+				pos++;
+			} else if (buf[pos] == '#') {
+				while (pos < len && buf[pos] != '\n')
+					pos++;
+			} else if (ntok == LENGTH(tok)) {
+				err = "too many arguments";
+				break;
+			} else {
+				tok[ntok++] = out;
+				while (pos < len && buf[pos] != ' ' && buf[pos] != '\t' && buf[pos] != '\n')
+					*out++ = buf[pos++];
+				*out++ = '\0';
+			}
+		}
+		if (!err && ntok)
+			err = parseline(&p, tok, ntok);
+		if (!err) {
+			pos++;
+			line++;
+		}
+	}
+	if (err) {
+		fprintf(stderr, "xiwm: %s:%u: %s\n", path, line, err);
+		free(p.keys);
+		free(p.rules);
+		freeconfig(c);
+		return NULL;
+	}
+
+	for (i = 0; i < c->nkeys; i++)
+		if (p.keys[i].func == spawn)
+			p.keys[i].arg.v = c->argv + p.keys[i].arg.ui;
+	c->keys = p.keys;
+	c->rules = p.rules;
+	/* sections missing from the file keep the compiled-in defaults */
+	if (!c->nkeys) {
+		c->keys = defconfig.keys;
+		c->nkeys = defconfig.nkeys;
+	}
+	if (!c->nrules) {
+		c->rules = defconfig.rules;
+		c->nrules = defconfig.nrules;
+	}
+	return c;
+}
+
+Config *
+readconfig(void)
+{
+	int fd;
+	struct stat st;
+	char *buf = NULL;
+	Config *c;
+	long long t;
+
+	if ((fd = open(configpath, O_RDONLY|O_CLOEXEC)) < 0)
+		return errno == ENOENT ? &defconfig : NULL;
+	if (fstat(fd, &st) < 0 || (st.st_size && (buf = mmap(NULL, st.st_size,
+		PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		fprintf(stderr, "xiwm: %s: %s\n", configpath, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	t = now();
+	c = parseconfig(configpath, buf, st.st_size);
+	record(MConfig, now() - t);
+	if (buf)
+		munmap(buf, st.st_size);
+	return c;
+}
+
+void
+setconfig(Config *c)
+{
+	Client *i;
+	Monitor *m;
+	Config *old = cfg;
+
+	if (!c || c == cfg)
+		return;
+	cfg = c;
+	freeconfig(old);
+	grabkeys();
+	for (m = mons; m; m = m->next)
+		for (i = m->clients; i; i = i->next)
+			XSetWindowBorder(dpy, i->win, cfg->colnorm);
+	focus(sel[desktop]);
+	layout(NULL);
+}
+
+void
+configchanged(void)
 {
-	c->next = clients;
-	clients = c;
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct inotify_event *ev;
+	char *p;
+	ssize_t len;
+	Bool changed = False;
+
+	while ((len = read(inotifyfd, u.buf, sizeof u.buf)) > 0)
+		for (p = u.buf; p < u.buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (!ev->len)
+				continue;
+			if (ev->wd == configwd && !strcmp(ev->name, "config"))
+				changed = True;
+			else if (ev->wd != configwd && (ev->mask & IN_ISDIR)
+			&& !strcmp(ev->name, "xiwm")) {
+				/* the directory was created after startup */
+				configwd = inotify_add_watch(inotifyfd, configdir, CONFIGMASK);
+				changed = True;
+			}
+		}
+	if (changed)
+		setconfig(readconfig());
 }
 
 void
-detach(Client *c)
+setupconfig(void)
 {
-	int i;
-	Client **tc;
-
-	for (tc = &clients; *tc && *tc != c; tc = &(*tc)->next);
-	*tc = c->next;
+	const char *home = getenv("HOME");
+	char *p;
+	int wd;
+	Config *c;
 
-	for (i = 0; i < DESKTOPS; i++)
-		if (c == sel[i])
-			sel[i] = c->transient;
+	if (!home)
+		return;
+	configdir = malloc(strlen(home) + sizeof "/.config/xiwm/config");
+	configpath = malloc(strlen(home) + sizeof "/.config/xiwm/config");
+	sprintf(configdir, "%s/.config/xiwm", home);
+	sprintf(configpath, "%s/config", configdir);
+
+	/* watch the directory so that editors which replace the file are noticed,
+	 * and ~/.config in case the directory does not exist yet */
+	if ((inotifyfd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) >= 0) {
+		configwd = inotify_add_watch(inotifyfd, configdir, CONFIGMASK);
+		p = strrchr(configdir, '/');
+		*p = '\0';
+		wd = inotify_add_watch(inotifyfd, configdir, IN_CREATE|IN_MOVED_TO);
+		*p = '/';
+		if (configwd < 0 && wd < 0) {
+			close(inotifyfd);
+			inotifyfd = -1;
+		}
+	}
+	if ((c = readconfig()))
+		cfg = c;
 }
 
+/* event handlers */
 void
-focus(Client *c)
+keypress(XEvent *e)
 {
-	Client *i, *d;
+	unsigned int i;
+	KeySym keysym;
+	XKeyEvent *ev;
 
-	if (!c || !ISVISIBLE(c))
-		for (c = clients; c && !ISVISIBLE(c); c = c->next);
-	if (sel[desktop] && sel[desktop] != c) {
-		grabbuttons(sel[desktop], False);
-		XSetWindowBorder(dpy, sel[desktop]->win, COL_NORM);
-	}
-	if (c) {
-		d = c;
-		for (i = clients; i; i = i->next)
-			if (i->transient == c)
-				d = i;
-		XSetWindowBorder(dpy, d->win, COL_HIGH);
-		grabbuttons(c, True);
-		XSetInputFocus(dpy, d->win, RevertToPointerRoot, CurrentTime);
-		XChangeProperty(dpy, root, netatom[NetActiveWindow], XA_WINDOW, 32,
-			PropModeReplace, (unsigned char *) &(d->win), 1);
-	} else {
-		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
-	}
-	sel[desktop] = c;
-	restack();
+	ev = &e->xkey;
+	keytime = now();
+	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
+	for (i = 0; i < cfg->nkeys; i++)
+		if (keysym == cfg->keys[i].keysym
+		&& CLEANMASK(cfg->keys[i].mod) == CLEANMASK(ev->state)
+		&& cfg->keys[i].func)
+			cfg->keys[i].func(&(cfg->keys[i].arg));
 }
 
-void
-manage(Window w, XWindowAttributes *wa)
+Bool
+modsheld(void)
 {
-	Client *c, *t = NULL;
-	Window trans = None;
-
-	c = calloc(1, sizeof(Client));
-	c->win = w;
-	c->position = PMax;
-	c->desktop = desktop;
-	/* geometry */
-	c->fx = c->x = wa->x == 0 ? (sw - wa->width) / 2 : wa->x;
-	c->fy = c->y = wa->y == 0 ? (sh + bh - wa->height) / 2 : wa->y;
+	int di;
+	unsigned int mask;
+	Window dw;
 
-	c->fw = c->w = wa->width;
-	c->fh = c->h = wa->height;
+	/* Shift only selects the direction, releasing it does not end a cycle */
+	return XQueryPointer(dpy, root, &dw, &dw, &di, &di, &di, &di, &mask)
+		&& (mask & (ControlMask|Mod1Mask|Mod4Mask));
+}
 
-	applyrules(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans)))
-		c->desktop = t->desktop;
-	c->transient = t;
-	xsetclientdesktop(c);
-	updatewindowtype(c);
-	updatefixed(c);
-	if (trans != None || c->isfixed)
-		c->position = PFloat;
+void
+mrucycleend(void)
+{
+	mrucycle = False;
+	XUngrabKeyboard(dpy, CurrentTime);
+	if (sel[desktop])
+		mrupromote(sel[desktop]);
+}
 
-	if (c->isdock)
-		bh = c->h;
+void
+keyrelease(XEvent *e)
+{
+	if (mrucycle && IsModifierKey(XKeycodeToKeysym(dpy, (KeyCode)e->xkey.keycode, 0))
+	&& !modsheld())
+		mrucycleend();
+}
 
-	XSetWindowBorder(dpy, c->win, COL_NORM);
-	XSelectInput(dpy, w, WINMASK);
-	grabbuttons(c, False);
-	attach(c);
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-		PropModeAppend, (unsigned char *) &(c->win), 1);
-	xsetclientstate(c, NormalState);
-	XMapWindow(dpy, c->win);
-	focus(NULL);
-	layout();
+long long
+sooner(long long a, long long b)
+{
+	return a && (!b || a < b) ? a : b;
 }
 
-void
-unmanage(Client *c)
+long long
+timers(void)
 {
-	Client *i;
+	Client *c;
+	Monitor *m;
+	long long t = now(), deadline = 0;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			if (c->syncdeadline && c->syncdeadline <= t)
+				syncdone(c);
+			if (c->killdeadline && c->killdeadline <= t) {
+				/* no answer to the ping, the client is hung */
+				c->killdeadline = 0;
+				killwindow(c);
+			}
+			deadline = sooner(deadline, sooner(c->syncdeadline, c->killdeadline));
+		}
+	return deadline;
+}
 
-	detach(c);
-	free(c);
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	for (i = clients; i; i = i->next)
-		XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-			PropModeAppend, (unsigned char *) &(i->win), 1);
-	focus(sel[desktop]);
-	layout();
+Bool
+waitevent(XEvent *ev, long mask, long long deadline)
+{
+	struct pollfd pfd = { ConnectionNumber(dpy), POLLIN, 0 };
+	long long t, next;
+	XEvent aev;
+	int queued;
+
+	while (!XCheckMaskEvent(dpy, mask, ev)) {
+		queued = XEventsQueued(dpy, QueuedAlready);
+		/* extension events cannot be selected by mask */
+		while (hassync && XCheckTypedEvent(dpy, syncevbase + XSyncAlarmNotify, &aev))
+			syncalarm(&aev);
+		if (deadline && deadline <= now())
+			return False;
+		next = timers();
+		t = (next && (!deadline || next < deadline) ? next : deadline) - now();
+		/* alarms and timers may have read events off the socket into the queue */
+		if (XEventsQueued(dpy, QueuedAlready) != queued)
+			continue;
+		poll(&pfd, 1, deadline || next ? MAX((t + 999) / 1000, 0) : -1);
+	}
+	return True;
 }
 
-/* event handlers */
 void
-keypress(XEvent *e)
+sendmon(Client *c, Monitor *m)
 {
-	unsigned int i;
-	KeySym keysym;
-	XKeyEvent *ev;
+	Monitor *old = c->mon;
 
-	ev = &e->xkey;
-	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
-	for (i = 0; i < LENGTH(keys); i++)
-		if (keysym == keys[i].keysym
-		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-		&& keys[i].func)
-			keys[i].func(&(keys[i].arg));
+	setfullscreen(c, False);
+	detach(c);
+	c->mon = m;
+	attach(c);
+	layout(old);
+	layout(m);
+	focus(c);
 }
 
 void
 movemouse(void)
 {
-	int x, y, ocx, ocy, nx, ny, di;
+	int x, y, ocx, ocy, nx = 0, ny = 0, di;
 	unsigned int dui;
 	Client *c;
 	XEvent ev;
-	Time lasttime = 0;
 	Window dummy;
+	Monitor *m;
+	long long last = 0, motion = 0, frame;
 
 	if (!(c = sel[desktop]))
 		return;
 	if (c->isfullscreen || c->position != PFloat)
 		return;
+	frame = 1000000 / c->mon->refresh;
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -565,60 +1962,87 @@ movemouse(void)
 	if (!XQueryPointer(dpy, root, &dummy, &dummy, &x, &y, &di, &di, &dui))
 		return;
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		/* motion is only applied once per frame, with the newest position */
+		if (!waitevent(&ev, MOUSEMASK|ExposureMask|SubstructureRedirectMask,
+			motion ? last + frame : 0)) {
+			if (c->position == PFloat)
+				resize(c, nx, ny, c->w, c->h, 1);
+			last = now();
+			record(MMotion, last - motion);
+			motion = 0;
+			continue;
+		}
 		switch(ev.type) {
 		case ConfigureRequest:
 		case MapRequest:
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 60))
-				continue;
-			lasttime = ev.xmotion.time;
-
+			while (XCheckTypedEvent(dpy, MotionNotify, &ev));
+			if (!motion)
+				motion = now();
 			nx = ocx + (ev.xmotion.x - x);
 			ny = ocy + (ev.xmotion.y - y);
+			break;
+		case ButtonRelease:
 			if (c->position == PFloat)
-				resize(c, nx, ny, c->w, c->h, 1);
+				resize(c, ocx + (ev.xbutton.x - x), ocy + (ev.xbutton.y - y),
+					c->w, c->h, 1);
 			break;
 		}
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
+	if ((m = recttomon(c->x, c->y, c->w, c->h)) != c->mon)
+		sendmon(c, m);
 }
 
 void
 resizemouse(void)
 {
-	int ocx, ocy, nw, nh;
+	int ocx, ocy, nw = 1, nh = 1;
 	Client *c;
 	XEvent ev;
-	Time lasttime = 0;
+	Bool moved = False;
+	long long last = 0, motion = 0, frame;
 
 	if (!(c = sel[desktop]))
 		return;
 	if (c->isfullscreen || c->position != PFloat)
 		return;
+	frame = 1000000 / c->mon->refresh;
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
 		None, None, CurrentTime) != GrabSuccess)
 		return;
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		if (!waitevent(&ev, MOUSEMASK|ExposureMask|SubstructureRedirectMask,
+			motion ? last + frame : 0)) {
+			if (c->position == PFloat)
+				resize(c, c->x, c->y, nw, nh, 1);
+			last = now();
+			record(MMotion, last - motion);
+			motion = 0;
+			continue;
+		}
 		switch(ev.type) {
 		case ConfigureRequest:
 		case MapRequest:
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 60))
-				continue;
-			lasttime = ev.xmotion.time;
-
+			while (XCheckTypedEvent(dpy, MotionNotify, &ev));
+			if (!motion)
+				motion = now();
+			moved = True;
 			nw = MAX(ev.xmotion.x - ocx - 1, 1);
 			nh = MAX(ev.xmotion.y - ocy - 1, 1);
-			if (c->position == PFloat)
-				resize(c, c->x, c->y, nw, nh, 1);
+			break;
+		case ButtonRelease:
+			/* a click without dragging leaves the window alone */
+			if (moved && c->position == PFloat)
+				resize(c, c->x, c->y, MAX(ev.xbutton.x - ocx - 1, 1),
+					MAX(ev.xbutton.y - ocy - 1, 1), 1);
 			break;
 		}
 	} while (ev.type != ButtonRelease);
@@ -630,9 +2054,13 @@ void
 buttonpress(XEvent *e)
 {
 	Client *c;
+	Monitor *m;
 	XButtonPressedEvent *ev = &e->xbutton;
 
-	if ((c = wintoclient(ev->window))) {
+	if (ev->window == root && (m = recttomon(ev->x_root, ev->y_root, 1, 1)) != selmon) {
+		selmon = m;
+		focus(NULL);
+	} else if ((c = wintoclient(ev->window))) {
 		XAllowEvents(dpy, ReplayPointer, CurrentTime);
 		if (c->isdock)
 			return;
@@ -650,8 +2078,15 @@ void
 clientmessage(XEvent *e)
 {
 	XClientMessageEvent *cme = &e->xclient;
-	Client *c = wintoclient(cme->window);
+	Client *c = wintoclient(cme->window), *f;
 
+	if (cme->message_type == wmatom[WMProtocols]
+	&& (Atom)cme->data.l[0] == netatom[NetWMPing]) {
+		/* still responsive, let it take its time to close */
+		if ((c = wintoclient(cme->data.l[2])))
+			c->killdeadline = 0;
+		return;
+	}
 	if (!c)
 		return;
 	if (cme->message_type == netatom[NetWMState]) {
@@ -659,6 +2094,8 @@ clientmessage(XEvent *e)
 		|| cme->data.l[2] == netatom[NetWMFullscreen])
 			setfullscreen(c, (cme->data.l[0] == 1 || (cme->data.l[0] == 2 && !c->isfullscreen)));
 	} else if (cme->message_type == netatom[NetActiveWindow]) {
+		if ((f = c->mon->fs[c->desktop]) && c != f && c->transient != f)
+			setfullscreen(f, False);
 		if (c != sel[desktop]) {
 			setdesktop(c->desktop);
 			focus(c);
@@ -705,6 +2142,46 @@ configurerequest(XEvent *e)
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 }
 
+void
+configurenotify(XEvent *e)
+{
+	XConfigureEvent *ev = &e->xconfigure;
+
+	if (ev->window == root && (ev->width != sw || ev->height != sh)) {
+		sw = ev->width;
+		sh = ev->height;
+		updategeom();
+	}
+}
+
+void
+propertynotify(XEvent *e)
+{
+	XPropertyEvent *ev = &e->xproperty;
+	Client *c;
+
+	/* killclient() trusts the cached protocols, keep them current */
+	if (ev->atom == wmatom[WMProtocols] && (c = wintoclient(ev->window)))
+		updateprotocols(c);
+	/* panels change their other properties often, those are not our business */
+	else if ((ev->atom == netatom[NetWMStrutPartial] || ev->atom == netatom[NetWMStrut])
+	&& (c = wintoclient(ev->window)) && c->isdock) {
+		updatestrut(c);
+		updateworkarea();
+	}
+}
+
+#ifdef XRANDR
+void
+rrscreenchange(XEvent *e)
+{
+	XRRUpdateConfiguration(e);
+	sw = ((XRRScreenChangeNotifyEvent *)e)->width;
+	sh = ((XRRScreenChangeNotifyEvent *)e)->height;
+	updategeom();
+}
+#endif /* XRANDR */
+
 void
 maprequest(XEvent *e)
 {
@@ -731,8 +2208,11 @@ tag(const Arg *arg)
 		return;
 	if (c->desktop == arg->ui)
 		return;
-	sel[desktop] = NULL;
+	setfullscreen(c, False);
+	mrudetach(c);
+	sel[desktop] = mru[desktop];
 	c->desktop = arg->ui;
+	mruattach(c, True);
 	xsetclientdesktop(c);
 	setdesktop(arg->ui);
 	focus(c);
@@ -766,12 +2246,26 @@ focusstack(const Arg *arg)
 
 	if (!sel[desktop])
 		return;
+	if (FOCUSMRU) {
+		/* walk the ring without reordering it until the modifier is released,
+		 * so repeated presses reach older windows and a single one toggles */
+		if (!mrucycle)
+			mrucycle = XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync,
+				CurrentTime) == GrabSuccess;
+		for (c = arg->i > 0 ? sel[desktop]->mnext : sel[desktop]->mprev;
+			c && c != sel[desktop] && (c->mon != sel[desktop]->mon || c->transient);
+			c = arg->i > 0 ? c->mnext : c->mprev);
+		focus(c);
+		if (!mrucycle || !modsheld())
+			mrucycleend();
+		return;
+	}
 	if (arg->i > 0) {
 		for (c = sel[desktop]->next; c && (!ISVISIBLE(c) || c->transient); c = c->next);
 		if (!c)
-			for (c = clients; c && (!ISVISIBLE(c) || c->transient); c = c->next);
+			for (c = sel[desktop]->mon->clients; c && (!ISVISIBLE(c) || c->transient); c = c->next);
 	} else {
-		for (i = clients; i && i != sel[desktop]; i = i->next)
+		for (i = sel[desktop]->mon->clients; i && i != sel[desktop]; i = i->next)
 			if (ISVISIBLE(i) && !i->transient)
 				c = i;
 		if (!c)
@@ -789,53 +2283,388 @@ setposition(const Arg *arg)
 	if (!sel[desktop])
 		return;
 	sel[desktop]->position = arg->i;
-	layout();
+	layout(sel[desktop]->mon);
 	restack();
 }
 
 void
 setmfact(const Arg *arg)
 {
-	mfact += arg->f;
-	layout();
+	selmon->mfact[desktop] += arg->f;
+	layout(selmon);
+}
+
+void
+setlayout(const Arg *arg)
+{
+	if (arg->i < 0 || arg->i >= LENGTH(layouts))
+		return;
+	selmon->lt[desktop] = arg->i;
+	layout(selmon);
+}
+
+void
+focusmon(const Arg *arg)
+{
+	if (!mons->next)
+		return;
+	selmon = dirtomon(selmon, arg->i);
+	focus(NULL);
+}
+
+void
+tagmon(const Arg *arg)
+{
+	Client *c;
+	Monitor *m;
+
+	if (!(c = sel[desktop]) || !mons->next)
+		return;
+	m = dirtomon(c->mon, arg->i);
+	c->fx += m->mx - c->mon->mx;
+	c->fy += m->my - c->mon->my;
+	sendmon(c, m);
 }
 
 void
 killclient(const Arg *arg)
 {
-	if (!sel[desktop])
+	Client *c;
+	long long t = now();
+
+	if (!(c = sel[desktop]))
 		return;
-	if (!sendevent(sel[desktop], wmatom[WMDelete])) {
-		XGrabServer(dpy);
-		XSetCloseDownMode(dpy, DestroyAll);
-		XKillClient(dpy, sel[desktop]->win);
-		XUngrabServer(dpy);
+	/* asking again after the timeout means the client did not react */
+	if (!c->candelete || (c->closetime && t - c->closetime > KILLTIMEOUT * 1000LL)) {
+		if (!c->closetime)
+			c->closetime = t;
+		killwindow(c);
+		return;
+	}
+	if (!c->closetime)
+		c->closetime = t;
+	sendevent(c, wmatom[WMDelete], 0, 0);
+	if (c->canping) {
+		sendevent(c, netatom[NetWMPing], c->win, 0);
+		c->killdeadline = t + KILLTIMEOUT * 1000LL;
 	}
 }
 
+pid_t
+launch(char *const argv[])
+{
+	pid_t pid;
+	int err;
+
+	/* returns once the child has exec'd, the X connection is close-on-exec */
+	if ((err = posix_spawnp(&pid, argv[0], NULL, &spawnattr, argv, environ))) {
+		fprintf(stderr, "xiwm: cannot spawn %s: %s\n", argv[0], strerror(err));
+		return -1;
+	}
+	return pid;
+}
+
 void
 spawn(const Arg *arg)
 {
-	if (fork())
+	pid_t pid;
+
+	if ((pid = launch((char *const *)arg->v)) < 0)
 		return;
-	if (dpy)
-		close(ConnectionNumber(dpy));
-	setsid();
-	execvp(((char **)arg->v)[0], (char **)arg->v);
+	record(MSpawnExec, now() - keytime);
+	launches[nextlaunch].pid = pid;
+	launches[nextlaunch].time = keytime;
+	nextlaunch = (nextlaunch + 1) % LENGTH(launches);
+}
+
+void
+restart(const Arg *arg)
+{
+	Client *c;
+	Monitor *m;
+	long *data, *p;
+	unsigned int i, n = 0, nmons = 0;
+
+	for (m = mons; m; m = m->next, nmons++)
+		for (c = m->clients; c; c = c->next)
+			n++;
+	p = data = calloc(4 + DESKTOPS + nmons * 2 * DESKTOPS + n * STATECLIENT, sizeof(long));
+	*p++ = STATEVERSION;
+	*p++ = DESKTOPS;
+	*p++ = desktop;
+	*p++ = nmons;
+	for (i = 0; i < DESKTOPS; i++)
+		*p++ = sel[i] ? sel[i]->win : None;
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < DESKTOPS; i++) {
+			*p++ = m->mfact[i] * 10000;
+			*p++ = m->lt[i];
+		}
+	for (m = mons, i = 0; m; m = m->next, i++)
+		for (c = m->clients; c; c = c->next) {
+			*p++ = c->win;
+			*p++ = c->transient ? c->transient->win : None;
+			*p++ = c->desktop;
+			*p++ = c->position;
+			*p++ = c->isfullscreen | c->isdock << 1 | c->isfixed << 2
+				| c->candelete << 3 | c->canping << 4 | c->setbypass << 5;
+			*p++ = c->x;
+			*p++ = c->y;
+			*p++ = c->w;
+			*p++ = c->h;
+			*p++ = c->fx;
+			*p++ = c->fy;
+			*p++ = c->fw;
+			*p++ = c->fh;
+			*p++ = c->synccounter;
+			*p++ = i;
+		}
+	XChangeProperty(dpy, root, wmatom[XiwmState], XA_CARDINAL, 32,
+		PropModeReplace, (unsigned char *) data, p - data);
+	free(data);
+
+	/* the new instance needs SubstructureRedirect, so let go of it first */
+	XCloseDisplay(dpy);
+	execvp(args[0], args);
+	die("xiwm: cannot restart %s:", args[0]);
 }
 
 /* main */
+Client *
+restoreclient(long *p)
+{
+	Client *c;
+	Monitor *m;
+	long i;
+
+	c = calloc(1, sizeof(Client));
+	c->win = p[0];
+	c->desktop = MIN(p[2], DESKTOPS - 1);
+	c->position = p[3];
+	c->isfullscreen = !!(p[4] & 1);
+	c->isdock = !!(p[4] & 2);
+	c->isfixed = !!(p[4] & 4);
+	c->candelete = !!(p[4] & 8);
+	c->canping = !!(p[4] & 16);
+	c->setbypass = !!(p[4] & 32);
+	c->x = p[5];
+	c->y = p[6];
+	c->w = p[7];
+	c->h = p[8];
+	c->fx = p[9];
+	c->fy = p[10];
+	c->fw = p[11];
+	c->fh = p[12];
+	if (hassync)
+		c->synccounter = p[13];
+	for (m = mons, i = p[14]; m->next && i > 0; m = m->next, i--);
+	c->mon = m;
+	if (c->isdock)
+		updatestrut(c);
+	if (c->isfullscreen)
+		m->fs[c->desktop] = c;
+
+	XSetWindowBorder(dpy, c->win, cfg->colnorm);
+	XSelectInput(dpy, c->win, WINMASK);
+	grabbuttons(c, False);
+	attach(c);
+	return c;
+}
+
+void
+restorestate(Window *wins, unsigned int nwins)
+{
+	int di;
+	unsigned long i, j, n, h, nc, dl;
+	unsigned char *prop = NULL;
+	long *data;
+	Atom da;
+	Client *c;
+	Monitor *m;
+
+	if (XGetWindowProperty(dpy, root, wmatom[XiwmState], 0L, ~0UL >> 2, True,
+		XA_CARDINAL, &da, &di, &n, &dl, &prop) != Success || !prop)
+		return;
+	/* even state we cannot use means the session is already running */
+	restarted = True;
+	data = (long *)prop;
+	h = n >= 4 && data[1] >= 0 && data[3] >= 0 ? 4 + data[1] + data[3] * 2 * data[1] : 0;
+	if (!h || data[0] != STATEVERSION || n < h || (n - h) % STATECLIENT) {
+		XFree(prop);
+		return;
+	}
+
+	/* attach() prepends, so walk backwards to keep the stacking order */
+	for (nc = (n - h) / STATECLIENT; nc--; )
+		for (i = h + nc * STATECLIENT, j = 0; j < nwins; j++)
+			if (wins[j] == (Window)data[i]) {
+				restoreclient(&data[i]);
+				wins[j] = None;
+				break;
+			}
+	for (i = h; i < n; i += STATECLIENT)
+		if ((c = wintoclient(data[i])))
+			c->transient = wintoclient(data[i + 1]);
+	for (i = 0; i < MIN(data[1], DESKTOPS); i++)
+		sel[i] = wintoclient(data[4 + i]);
+	for (m = mons, i = 0; m && i < (unsigned long)data[3]; m = m->next, i++)
+		for (j = 0; j < MIN(data[1], DESKTOPS); j++) {
+			m->mfact[j] = data[4 + data[1] + (i * data[1] + j) * 2] / 10000.0;
+			if (data[5 + data[1] + (i * data[1] + j) * 2] < LENGTH(layouts))
+				m->lt[j] = data[5 + data[1] + (i * data[1] + j) * 2];
+		}
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < DESKTOPS; i++)
+			if (m->fs[i])
+				suspendsiblings(m->fs[i], True);
+	updateworkarea();
+	setdesktop(MIN(data[2], DESKTOPS - 1));
+	XFree(prop);
+}
+
+void
+scan(void)
+{
+	unsigned int i, pass, n;
+	Window d1, d2, *wins = NULL, trans;
+	XWindowAttributes wa;
+
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &n))
+		return;
+	restorestate(wins, n);
+	updateclientlist();
+
+	/* adopt windows we know nothing about, transients last */
+	for (pass = 0; pass < 2; pass++)
+		for (i = 0; i < n; i++) {
+			if (wins[i] == None || !XGetWindowAttributes(dpy, wins[i], &wa)
+			|| wa.override_redirect || wa.map_state != IsViewable
+			|| !!XGetTransientForHint(dpy, wins[i], &trans) != pass)
+				continue;
+			manage(wins[i], &wa);
+		}
+	if (wins)
+		XFree(wins);
+}
+
+void
+setupshm(void)
+{
+	char name[64], *p;
+	struct stat st;
+
+	/* one segment per display, reused across restarts so readers can stay mapped */
+	snprintf(name, sizeof(name), "/xiwm-%s", DisplayString(dpy));
+	for (p = name + 1; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	if ((shmfd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		fprintf(stderr, "xiwm: shm_open %s: %s\n", name, strerror(errno));
+		return;
+	}
+	/* the name is easy to guess, someone else could have created it first */
+	if (fstat(shmfd, &st) < 0 || st.st_uid != getuid() || fchmod(shmfd, 0600) < 0) {
+		fprintf(stderr, "xiwm: %s is not ours, not publishing state\n", name);
+		close(shmfd);
+		shmfd = -1;
+		return;
+	}
+	if (st.st_size >= (off_t)sizeof(ShmHeader)) {
+		if ((shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shmfd, 0)) == MAP_FAILED)
+			shm = NULL;
+		else
+			shmsize = st.st_size;
+	}
+	XChangeProperty(dpy, root, wmatom[XiwmShm], XA_STRING, 8,
+		PropModeReplace, (unsigned char *) name, strlen(name));
+}
+
+/* write the snapshot under a seqlock, readers retry while seq is odd or changed */
+void
+publishstate(void)
+{
+	Client *c;
+	Monitor *m;
+	ShmClient *sc;
+	size_t size, n = 0;
+	uint32_t seq, i;
+
+	if (shmfd < 0)
+		return;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			n++;
+	size = sizeof(ShmHeader) + n * sizeof(ShmClient);
+	if (size > shmsize) {
+		/* never shrink, readers may still map the old size */
+		size = MAX(size * 2, 4096);
+		if (ftruncate(shmfd, size) < 0) {
+			fprintf(stderr, "xiwm: ftruncate: %s\n", strerror(errno));
+			return;
+		}
+		if (shm)
+			munmap(shm, shmsize);
+		if ((shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shmfd, 0)) == MAP_FAILED) {
+			shm = NULL;
+			shmsize = 0;
+			return;
+		}
+		shmsize = size;
+	}
+
+	seq = shm->seq | 1;
+	__atomic_store_n(&shm->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->magic = SHMMAGIC;
+	shm->version = SHMVERSION;
+	shm->size = sizeof(ShmHeader) + n * sizeof(ShmClient);
+	shm->desktop = desktop;
+	shm->ndesktops = DESKTOPS;
+	shm->active = sel[desktop] ? sel[desktop]->win : 0;
+	shm->layout = selmon->lt[desktop];
+	shm->mfact = selmon->mfact[desktop];
+	shm->nclients = n;
+	sc = (ShmClient *)(shm + 1);
+	for (m = mons, i = 0; m; m = m->next, i++)
+		for (c = m->clients; c; c = c->next, sc++) {
+			sc->win = c->win;
+			sc->desktop = c->desktop;
+			sc->position = c->position;
+			sc->flags = c->isfullscreen | c->isdock << 1 | (c == sel[c->desktop]) << 2;
+			sc->x = c->x;
+			sc->y = c->y;
+			sc->w = c->w;
+			sc->h = c->h;
+			sc->monitor = i;
+		}
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
 void
 setup(void)
 {
-	int i, screen;
+	int i, screen, major, minor;
+#ifdef XRANDR
+	int rrerrbase;
+#endif /* XRANDR */
 	Atom utf8string;
 	const unsigned int desktops = DESKTOPS;
 
-	XSetErrorHandler(xerrordummy);
+	starttime = now();
+	XSetErrorHandler(xerror);
+	setorigin("setup");
 
 	/* clean up any zombies immediately */
 	sigchld(0);
+	sigusr1(0);
+	dumpmetrics = 0;
+
+	/* children get their own session and none of our descriptors */
+	posix_spawnattr_init(&spawnattr);
+	posix_spawnattr_setflags(&spawnattr, POSIX_SPAWN_SETSID);
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
 
 	for (i = 0; i < DESKTOPS; i++)
 		sel[i] = NULL;
@@ -845,13 +2674,20 @@ setup(void)
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	bh = 0;
+#ifdef XRANDR
+	if ((hasrandr = XRRQueryExtension(dpy, &rrevbase, &rrerrbase)))
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask);
+#endif /* XRANDR */
+	hassync = XSyncQueryExtension(dpy, &syncevbase, &syncerrbase)
+		&& XSyncInitialize(dpy, &major, &minor);
 
 	/* init atoms */
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
 	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
 	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
 	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
+	wmatom[XiwmState] = XInternAtom(dpy, "_XIWM_STATE", False);
+	wmatom[XiwmShm] = XInternAtom(dpy, "_XIWM_SHM", False);
 	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
 	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
@@ -865,6 +2701,14 @@ setup(void)
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
 	netatom[NetCurrentDesktop] = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
 	netatom[NetNumberOfDesktops] = XInternAtom(dpy, "_NET_NUMBER_OF_DESKTOPS", False);
+	netatom[NetWMPid] = XInternAtom(dpy, "_NET_WM_PID", False);
+	netatom[NetWMSyncRequest] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	netatom[NetWMSyncRequestCounter] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
+	netatom[NetWMBypassCompositor] = XInternAtom(dpy, "_NET_WM_BYPASS_COMPOSITOR", False);
+	netatom[NetWMPing] = XInternAtom(dpy, "_NET_WM_PING", False);
+	netatom[NetWMStrut] = XInternAtom(dpy, "_NET_WM_STRUT", False);
+	netatom[NetWMStrutPartial] = XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False);
+	netatom[NetWorkarea] = XInternAtom(dpy, "_NET_WORKAREA", False);
 
 	/* supporting window for NetWMCheck */
 	wmcheckwin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
@@ -881,26 +2725,93 @@ setup(void)
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	XChangeProperty(dpy, root, netatom[NetNumberOfDesktops], XA_CARDINAL, 32,
 		PropModeReplace, (unsigned char *) &desktops, 1);
+	updategeom();
 
 	/* select events */
 	XSelectInput(dpy, root, ROOTMASK);
+	setupshm();
+	setupconfig();
 	grabkeys();
 	setdesktop(INIDESKTOP);
-	focus(NULL);
+	scan();
+	focus(sel[desktop]);
+	layout(NULL);
 }
 
 void
-runautostart(void) {
-	system("~/.config/xiwm/autostart.sh");
+runautostart(void)
+{
+	char path[4096];
+	char *argv[] = { path, NULL };
+	DIR *dir;
+	struct dirent *e;
+
+	if (!configdir)
+		return;
+
+	/* everything is started in parallel, nothing is waited for */
+	snprintf(path, sizeof path, "%s/autostart.sh", configdir);
+	if (!access(path, X_OK))
+		launch(argv);
+	snprintf(path, sizeof path, "%s/autostart.d", configdir);
+	if (!(dir = opendir(path)))
+		return;
+	while ((e = readdir(dir))) {
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof path, "%s/autostart.d/%s", configdir, e->d_name);
+		if (!access(path, X_OK))
+			launch(argv);
+	}
+	closedir(dir);
 }
 
 void
 run(void)
 {
 	XEvent ev;
-	while (!XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev);
+	long long next;
+	struct pollfd fds[] = {
+		{ ConnectionNumber(dpy), POLLIN, 0 },
+		{ inotifyfd, POLLIN, 0 },
+	};
+
+	for (;;) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			if (ev.type < LASTEvent && handler[ev.type]) {
+				setorigin(handlername[ev.type]);
+				handler[ev.type](&ev);
+			} else if (hassync && ev.type == syncevbase + XSyncAlarmNotify) {
+				setorigin("syncalarm");
+				syncalarm(&ev);
+			}
+#ifdef XRANDR
+			else if (hasrandr && ev.type == rrevbase + RRScreenChangeNotify) {
+				setorigin("rrscreenchange");
+				rrscreenchange(&ev);
+			}
+#endif /* XRANDR */
+		}
+		/* expired timers may have queued requests or read new events */
+		setorigin("timers");
+		next = timers();
+		if (XPending(dpy))
+			continue;
+		/* the batch is done, consumers see its result at once */
+		publishstate();
+		if (!dumpmetrics && poll(fds, LENGTH(fds),
+			next ? MAX((next - now() + 999) / 1000, 0) : -1) < 0 && errno != EINTR)
+			die("xiwm: poll:");
+		if (fds[1].revents & POLLIN) {
+			setorigin("configchanged");
+			configchanged();
+		}
+		if (dumpmetrics) {
+			dumpmetrics = 0;
+			printmetrics();
+		}
+	}
 }
 
 int
@@ -908,9 +2819,12 @@ main(int argc, char *argv[])
 {
 	if (argc != 1)
 		die("usage: xiwm");
+	args = argv;
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("xiwm: cannot open display");
 	setup();
-	runautostart();
+	if (!restarted)
+		runautostart();
 	run();
+	return EXIT_SUCCESS;
 }